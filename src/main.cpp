@@ -1,6 +1,6 @@
 #include "pch.hpp"
-using std::filesystem::exists, std::filesystem::is_directory, std::filesystem::path, std::format, std::wstring, std::wstring_view, winrt::check_bool, winrt::check_hresult, winrt::com_ptr, winrt::get_module_lock, winrt::hresult, winrt::hresult_error,
-	winrt::implements, winrt::make, winrt::throw_last_error, winrt::Windows::ApplicationModel::Resources::ResourceLoader;
+using std::atomic, std::error_code, std::filesystem::exists, std::filesystem::is_directory, std::filesystem::path, std::format, std::make_shared, std::shared_ptr, std::string, std::vector, std::wstring, std::wstring_view, winrt::check_bool, winrt::check_hresult, winrt::com_ptr, winrt::get_module_lock, winrt::hresult, winrt::hresult_error,
+	winrt::implements, winrt::make, winrt::throw_hresult, winrt::throw_last_error, winrt::Windows::ApplicationModel::Resources::ResourceLoader;
 
 /**
  * [Resource](https://learn.microsoft.com/en-us/uwp/api/windows.applicationmodel.resources.resourceloader) for the current non-UI-thread context.
@@ -19,6 +19,75 @@ static const wchar_t* LOC(wstring_view key) {
 	return resource.GetString(key).c_str();
 }
 
+/**
+ * Get the final path of an existing file or directory, with every link followed and the case and short names normalized.
+ * @param file The path to normalize
+ * @return The final path, or empty if `file` can't be opened
+ */
+[[nodiscard("Pure function")]]
+static const path normalize(const path& file) {
+	const auto handle = CreateFileW(file.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) [[unlikely]] return path();
+	wstring normalized(32767, 0);
+	const auto length = GetFinalPathNameByHandleW(handle, normalized.data(), 32767, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+	CloseHandle(handle);
+	if (length == 0 || length >= 32767) [[unlikely]] return path();
+
+	normalized.resize(length);
+	if (normalized.starts_with(L"\\\\?\\UNC\\")) {
+		normalized.replace(0, 8, L"\\\\");
+	}
+	else if (normalized.starts_with(L"\\\\?\\")) {
+		normalized.erase(0, 4);
+	}
+	return normalized;
+}
+
+/**
+ * Follow the link chain to the final target.
+ *
+ * The system walks the whole chain at once, and fails with `ERROR_CANT_RESOLVE_FILENAME` on loops.
+ *
+ * Other reparse points, for instance cloud files and app execution aliases, are not links.
+ * @param link The path to resolve
+ * @return The final target, or empty if `link` is not a symbolic link or junction, or can't be resolved
+ */
+[[nodiscard("Pure function")]]
+static const path resolve(const path& link) {
+	WIN32_FIND_DATAW data;
+	const auto find = FindFirstFileExW(link.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, 0);
+	if (find == INVALID_HANDLE_VALUE) [[unlikely]] return path();
+	FindClose(find);
+	if (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) || (data.dwReserved0 != IO_REPARSE_TAG_SYMLINK && data.dwReserved0 != IO_REPARSE_TAG_MOUNT_POINT)) [[likely]] return path();
+	return normalize(link);
+}
+
+/**
+ * Get the mount point of the volume where a path is, for instance `C:\` or `C:\mnt\volume\`.
+ * @param file The path to query
+ * @return The mount point, with a trailing backslash
+ */
+[[nodiscard("Pure function")]]
+static const wstring getVolume(const path& file) {
+	wstring volume(32767, 0);
+	check_bool(GetVolumePathNameW(file.c_str(), volume.data(), 32767));
+	volume.resize(volume.find(L'\0'));
+	return volume;
+}
+
+/**
+ * Get the long path form of a path, which is not limited by `MAX_PATH`, for instance `\\?\C:\dir` or `\\?\UNC\server\share`.
+ * @param file The absolute path to convert
+ * @return The path with the long path prefix
+ */
+[[nodiscard("Pure function")]]
+static const wstring getLongPath(const path& file) {
+	const auto file_string = file.lexically_normal().wstring();
+	if (file_string.starts_with(L"\\\\?\\")) [[unlikely]] return file_string;
+	if (file_string.starts_with(L"\\\\")) return L"\\\\?\\UNC\\" + file_string.substr(2);
+	return L"\\\\?\\" + file_string;
+}
+
 /**
  * A minimal [`IExplorerCommand`](https://learn.microsoft.com/en-us/windows/win32/api/shobjidl_core/nf-shobjidl_core-iexplorercommand-invoke) implementation with utility functions for linking.
  *
@@ -114,6 +183,69 @@ struct Command : implements<Command, IExplorerCommand> {
 		return SHStrDupW(tip.data(), ppszInfotip);
 	}
 
+	/**
+	 * Create a link to `target` in every destination directory.
+	 *
+	 * If user right-clicked on selected folders, a link is created in each of them. Otherwise, only in `directory`.
+	 *
+	 * Destinations which can't be linked are skipped and reported together, instead of stopping at the first one.
+	 * @param psiItemArray Input selected folders. Might be null
+	 * @param pbc Unused input. The context is given by the constructor
+	 * @return `S_OK` on command execution, the last error code if no link could be created
+	 */
+	HRESULT Invoke(IShellItemArray* psiItemArray, [[maybe_unused]] IBindCtx* pbc) {
+		wstring_view operation;
+		wstring report;
+		hresult code;
+		const auto test = [&operation, &report, &code](const path& link, const auto check) {
+			try {
+				check();
+			}
+			catch (const hresult_error e) {
+				if (uint16_t(e.code()) != ERROR_ACCESS_DENIED) [[unlikely]] {
+					code = e.code();
+					report += format(L"{}: {}\n", link.wstring(), e.message().c_str());
+					return false;
+				}
+				operation = L"runas";
+			}
+			return true;
+		};
+
+		vector<wstring> statements;
+		const auto tested = test(target, [this, &report] {
+			assertPermission(openTest());
+			prepare(report);
+		});
+		if (tested) [[likely]] {
+			for (const auto& destination : getDirectories(psiItemArray)) {
+				path link;
+				const auto accepted = test(destination, [this, &destination, &link] {
+					assertDestination(destination);
+					link = getLink(destination);
+					assertPermission(openLink(link));
+				});
+				if (accepted) [[likely]] {
+					const auto next = getStatements(link, destination);
+					statements.insert(statements.end(), next.begin(), next.end());
+				}
+			}
+		}
+
+		if (!report.empty()) [[unlikely]] {
+			MessageBoxW(nullptr, report.c_str(), LOC(L"Command.Error"), MB_ICONERROR);
+		}
+		if (statements.empty()) [[unlikely]] return code;
+		try {
+			execute(operation, statements);
+		}
+		catch (const hresult_error e) {
+			MessageBoxW(nullptr, e.message().c_str(), LOC(L"Command.Error"), MB_ICONERROR);
+			return e.code();
+		}
+		return S_OK;
+	}
+
 protected:
 	/**
 	 * The directory where the link will be created.
@@ -125,52 +257,69 @@ protected:
 	const path target;
 
 	/**
-	 * Create a link.
-	 *
-	 * Create another process. If current permissions are insufficient, the link will be created with elevated privileges.
+	 * Get the statements creating a link. Executed by `executable`.
 	 *
-	 * The link is not guaranteed to be created as users could cancel the privilege operation.
+	 * All statements of an invocation run in order, in a single process.
 	 *
-	 * Don't cover the main logic. Both executable and parameter must be specified.
+	 * Commands not creating links override `Invoke` instead.
 	 * @param link The link to create
-	 * @param parameter The command line parameters
-	 * @param test Extra permission to test. Should be the return value of [`CreateFile`](https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-createfilew)
-	 * @return `S_OK` on command execution, most likely
+	 * @param destination The directory where the link will be created
+	 * @return The statements, for instance `mklink "link" "target"`
 	 */
-	[[nodiscard("Please handle error")]]
-	const hresult createLink(const path link, const wstring_view parameter, void* const test = nullptr) const {
-		wstring_view operation;
-		try {
-			assertPermission(test);
-			assertPermission(CreateFileW(link.c_str(), FILE_WRITE_DATA, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr));
-		}
-		catch (const hresult_error e) {
-			const auto code = e.code();
-			if (uint16_t(code) != ERROR_ACCESS_DENIED) [[unlikely]] {
-				MessageBoxW(nullptr, e.message().c_str(), LOC(L"Command.Error"), MB_ICONERROR);
-				return code;
-			}
-			operation = L"runas";
-		}
+	[[nodiscard("Pure function")]]
+	virtual const vector<wstring> getStatements([[maybe_unused]] const path& link, [[maybe_unused]] const path& destination) const {
+		return {};
+	}
 
-		ShellExecuteW(nullptr, operation.data(), executable.data(), parameter.data(), nullptr, SW_HIDE);
-		return S_OK;
+	/**
+	 * Open the target to test extra permission. Default is no extra permission.
+	 * @return The return value of [`CreateFile`](https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-createfilew), or null
+	 */
+	[[nodiscard("Please close the handle")]]
+	virtual void* openTest() const {
+		return nullptr;
+	}
+
+	/**
+	 * Do the work shared by every destination, once per invocation. Default is nothing to do.
+	 * @param report Output a line for every part which can't be prepared
+	 */
+	virtual void prepare([[maybe_unused]] wstring& report) {}
+
+	/**
+	 * Assert a link to `target` can be created in a destination. Default is no restriction.
+	 *
+	 * If it can't, throw an error.
+	 * @param destination The directory where the link will be created
+	 */
+	virtual void assertDestination([[maybe_unused]] const path& destination) const {}
+
+	/**
+	 * Open the link to test the permission of creating it. Default is creating a temporary file deleted on close.
+	 * @param link The link to create
+	 * @return The return value of [`CreateFile`](https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-createfilew)
+	 */
+	[[nodiscard("Please close the handle")]]
+	virtual void* openLink(const path& link) const {
+		return CreateFileW(link.c_str(), FILE_WRITE_DATA, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
 	}
 
 	/**
 	 * Get the link path.
 	 *
 	 * If there's already a file. The link will be named as `stem (2).ext`, and so on.
+	 * @param destination The directory where the link will be created
 	 * @return The link path
 	 */
 	[[nodiscard("Pure function")]]
-	const path getLink() const {
-		const auto directory_string = directory.wstring();
-		path link = format(L"{}/{}{}", directory_string, target.filename().wstring(), extension);
+	virtual const path getLink(const path& destination) const {
+		const auto destination_string = destination.wstring();
+		path link = format(L"{}/{}{}", destination_string, target.filename().wstring(), extension);
 		const auto target_stem = target.stem().wstring();
 		const auto target_extension = target.extension().wstring();
-		for (auto i = 2; exists(link); i++) [[unlikely]] {
-			link = format(L"{}/{} ({}){}{}", directory_string, target_stem, i, target_extension, extension);
+		error_code error;
+		for (auto i = 2; exists(link, error); i++) [[unlikely]] {
+			link = format(L"{}/{} ({}){}{}", destination_string, target_stem, i, target_extension, extension);
 		}
 		return link;
 	}
@@ -209,6 +358,125 @@ private:
 		if (file == INVALID_HANDLE_VALUE) throw_last_error();
 		CloseHandle(file);
 	}
+
+	/**
+	 * Execute statements with `executable`.
+	 *
+	 * Create another process. If current permissions are insufficient, the links will be created with elevated privileges.
+	 *
+	 * The links are not guaranteed to be created as users could cancel the privilege operation. If the process is not started, the script is deleted, and any failure other than cancellation is thrown.
+	 *
+	 * All statements run in a single process, so there's at most one elevation prompt however many links are created. `cmd` rejects command lines longer than 8191 characters, so longer ones are run from a script instead.
+	 * @param operation `runas` to elevate, empty otherwise
+	 * @param statements The statements to execute
+	 */
+	void execute(const wstring_view operation, const vector<wstring>& statements) const {
+		const auto cmd = executable == L"cmd";
+		wstring parameter;
+		for (const auto& statement : statements) {
+			if (parameter.empty()) {
+				parameter = cmd ? L"/C " : L"-Command ";
+			}
+			else {
+				parameter += cmd ? L" & " : L"; ";
+			}
+			parameter += statement;
+		}
+
+		path script;
+		if (parameter.size() > 8000) [[unlikely]] {
+			script = writeScript(statements);
+			if (cmd) {
+				parameter = format(L"/C \"\"{}\"\"", script.wstring());
+			}
+			else {
+				parameter = format(L"-ExecutionPolicy Bypass -File \"{}\"", script.wstring());
+			}
+		}
+		if (INT_PTR(ShellExecuteW(nullptr, operation.data(), executable.data(), parameter.c_str(), nullptr, SW_HIDE)) <= 32) [[unlikely]] {
+			const auto error = GetLastError();
+			if (!script.empty()) DeleteFileW(script.c_str());
+			if (error != ERROR_CANCELLED) throw_hresult(HRESULT_FROM_WIN32(error));
+		}
+	}
+
+	/**
+	 * Write statements into a script in the temporary directory. The script deletes itself after running.
+	 *
+	 * The script is encoded in UTF-8. `cmd` needs `chcp 65001` to read it, while PowerShell needs a BOM.
+	 * @param statements The statements to write
+	 * @return The path of the script
+	 */
+	[[nodiscard("Please run the script")]]
+	const path writeScript(const vector<wstring>& statements) const {
+		const auto cmd = executable == L"cmd";
+		wstring temporary(MAX_PATH + 1, 0);
+		wstring name(MAX_PATH, 0);
+		check_bool(GetTempPathW(MAX_PATH + 1, temporary.data()));
+		check_bool(GetTempFileNameW(temporary.c_str(), L"lnk", 0, name.data()));
+		DeleteFileW(name.c_str());
+		const auto script = path(name.c_str()).replace_extension(cmd ? L".cmd" : L".ps1");
+
+		wstring content;
+		if (cmd) {
+			content = L"@echo off\r\nchcp 65001>nul\r\n";
+		}
+		else {
+			content = L"\uFEFF";
+		}
+		for (const auto& statement : statements) {
+			if (cmd) {
+				for (const auto character : statement) {
+					content += character;
+					if (character == L'%') content += L'%';
+				}
+			}
+			else {
+				content += statement;
+			}
+			content += L"\r\n";
+		}
+		content += cmd ? L"del \"%~f0\"\r\n" : L"Remove-Item -LiteralPath $PSCommandPath\r\n";
+
+		const auto size = WideCharToMultiByte(CP_UTF8, 0, content.data(), int(content.size()), nullptr, 0, nullptr, nullptr);
+		string utf8(size, 0);
+		WideCharToMultiByte(CP_UTF8, 0, content.data(), int(content.size()), utf8.data(), size, nullptr, nullptr);
+		const auto file = CreateFileW(script.c_str(), FILE_WRITE_DATA, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) [[unlikely]] throw_last_error();
+		DWORD written = 0;
+		const auto success = WriteFile(file, utf8.data(), DWORD(utf8.size()), &written, nullptr);
+		const auto error = GetLastError();
+		CloseHandle(file);
+		if (!success) [[unlikely]] {
+			DeleteFileW(script.c_str());
+			throw_hresult(HRESULT_FROM_WIN32(error));
+		}
+		return script;
+	}
+
+	/**
+	 * Get the directories where the links will be created.
+	 * @param items Selected items. Items which are not directories are ignored
+	 * @return Selected directories, or `directory` if nothing is selected
+	 */
+	[[nodiscard("Pure function")]]
+	const vector<path> getDirectories(IShellItemArray* const items) const {
+		DWORD count = 0;
+		if (items == nullptr || FAILED(items->GetCount(&count)) || count == 0) return {directory};
+
+		vector<path> directories;
+		directories.reserve(count);
+		error_code error;
+		for (DWORD i = 0; i < count; i++) {
+			com_ptr<IShellItem> item;
+			wchar_t* name = nullptr;
+			if (SUCCEEDED(items->GetItemAt(i, item.put())) && SUCCEEDED(item->GetDisplayName(SIGDN_FILESYSPATH, &name)) && is_directory(name, error)) [[likely]] {
+				directories.emplace_back(name);
+			}
+			CoTaskMemFree(name);
+		}
+		return directories;
+	}
 };
 
 /**
@@ -219,23 +487,41 @@ struct AbsoluteSymbolicLink : Command {
 	 * Initialize all member variables as is.
 	 * @param directory The directory where the link will be created
 	 * @param target The target file or directory to link to
+	 * @param resolved Whether `target` is the final target of the copied link
 	 */
-	AbsoluteSymbolicLink(path directory, path target) : Command(directory, target, L"shell32.dll,-51380", LOC(L"AbsoluteSymbolicLink.GetTitle"), LOC(L"AbsoluteSymbolicLink.GetToolTip")) {}
+	AbsoluteSymbolicLink(path directory, path target, bool resolved = false) :
+		Command(directory, target, L"shell32.dll,-51380", LOC(resolved ? L"AbsoluteSymbolicLink.Final.GetTitle" : L"AbsoluteSymbolicLink.GetTitle"), LOC(resolved ? L"AbsoluteSymbolicLink.Final.GetToolTip" : L"AbsoluteSymbolicLink.GetToolTip")) {}
 
 	/**
-	 * Create symbolic link with absolute path.
+	 * Get if the command is shown.
 	 * @param psiItemArray Unused input. The context is given by the constructor
-	 * @param pbc Unused input. The context is given by the constructor
-	 * @return `S_OK` on command execution, most likely
+	 * @param fOkToBeSlow Unused input. We are not slow
+	 * @param pCmdState Output `ECS_HIDDEN` if there's no `target`, which means the copied path is not a link to resolve, otherwise `ECS_ENABLED`
+	 * @return `S_OK`
 	 */
-	HRESULT Invoke([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] IBindCtx* pbc) {
+	HRESULT GetState([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] BOOL fOkToBeSlow, EXPCMDSTATE* pCmdState) {
+		if (target.empty()) [[unlikely]] {
+			*pCmdState = ECS_HIDDEN;
+		}
+		else {
+			*pCmdState = ECS_ENABLED;
+		}
+		return S_OK;
+	}
+
+	/**
+	 * Get the statements creating symbolic link with absolute path.
+	 * @param link The link to create
+	 * @param destination Unused input. The target is absolute
+	 * @return The `mklink` statement
+	 */
+	const vector<wstring> getStatements(const path& link, [[maybe_unused]] const path& destination) const {
 		wstring_view argument;
 		if (is_directory(target)) {
 			argument = L"/D";
 		}
 
-		const auto link = getLink();
-		return createLink(link, format(L"/C mklink {} \"{}\" \"{}\"", argument, link.wstring(), target.wstring()));
+		return {format(L"mklink {} \"{}\" \"{}\"", argument, link.wstring(), target.wstring())};
 	}
 };
 
@@ -247,18 +533,23 @@ struct RelativeSymbolicLink : Command {
 	 * Initialize all member variables as is.
 	 * @param directory The directory where the link will be created
 	 * @param target The target file or directory to link to
+	 * @param resolved Whether `target` is the final target of the copied link
 	 */
-	RelativeSymbolicLink(path directory, path target) : Command(directory, target, L"shell32.dll,-16801", LOC(L"RelativeSymbolicLink.GetTitle"), LOC(L"RelativeSymbolicLink.GetToolTip")) {}
+	RelativeSymbolicLink(path directory, path target, bool resolved = false) :
+		Command(directory, target, L"shell32.dll,-16801", LOC(resolved ? L"RelativeSymbolicLink.Final.GetTitle" : L"RelativeSymbolicLink.GetTitle"), LOC(resolved ? L"RelativeSymbolicLink.Final.GetToolTip" : L"RelativeSymbolicLink.GetToolTip")) {}
 
 	/**
 	 * Get if the command is enabled.
 	 * @param psiItemArray Unused input. The context is given by the constructor
 	 * @param fOkToBeSlow Unused input. We are not slow
-	 * @param pCmdState Output `ECS_ENABLED` if `directory` and `target` are in the same volume, otherwise `ECS_DISABLED`
+	 * @param pCmdState Output `ECS_HIDDEN` if there's no `target`, `ECS_ENABLED` if `directory` and `target` are in the same volume, otherwise `ECS_DISABLED`
 	 * @return `S_OK`
 	 */
 	HRESULT GetState([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] BOOL fOkToBeSlow, EXPCMDSTATE* pCmdState) {
-		if (directory.root_path() == target.root_path()) {
+		if (target.empty()) [[unlikely]] {
+			*pCmdState = ECS_HIDDEN;
+		}
+		else if (directory.root_path() == target.root_path()) {
 			*pCmdState = ECS_ENABLED;
 		}
 		else {
@@ -268,19 +559,26 @@ struct RelativeSymbolicLink : Command {
 	}
 
 	/**
-	 * Create symbolic link with relative path.
-	 * @param psiItemArray Unused input. The context is given by the constructor
-	 * @param pbc Unused input. The context is given by the constructor
-	 * @return `S_OK` on command execution, most likely
+	 * Get the statements creating symbolic link with relative path.
+	 * @param link The link to create
+	 * @param destination The directory where the link will be created. The target is relative to it
+	 * @return The `mklink` statement
 	 */
-	HRESULT Invoke([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] IBindCtx* pbc) {
+	const vector<wstring> getStatements(const path& link, const path& destination) const {
 		wstring_view argument;
 		if (is_directory(target)) {
 			argument = L"/D";
 		}
 
-		const auto link = getLink();
-		return createLink(link, format(L"/C mklink {} \"{}\" \"{}\"", argument, link.wstring(), target.lexically_relative(directory).wstring()));
+		return {format(L"mklink {} \"{}\" \"{}\"", argument, link.wstring(), target.lexically_relative(destination).wstring())};
+	}
+
+	/**
+	 * Assert `target` is reachable by a relative path from the destination.
+	 * @param destination The directory where the link will be created
+	 */
+	void assertDestination(const path& destination) const {
+		if (target.lexically_relative(destination).empty()) [[unlikely]] throw_hresult(HRESULT_FROM_WIN32(ERROR_NOT_SAME_DEVICE));
 	}
 };
 
@@ -313,14 +611,100 @@ struct HardLink : Command {
 	}
 
 	/**
-	 * Create a hard link.
+	 * Get the statements creating a hard link.
+	 * @param link The link to create
+	 * @param destination Unused input. Hard links have no target path
+	 * @return The `mklink` statement
+	 */
+	const vector<wstring> getStatements(const path& link, [[maybe_unused]] const path& destination) const {
+		return {format(L"mklink /H \"{}\" \"{}\"", link.wstring(), target.wstring())};
+	}
+
+	/**
+	 * Open the target to test if it is writable, which is required by hard links.
+	 * @return The return value of `CreateFile`
+	 */
+	void* openTest() const {
+		return CreateFileW(target.c_str(), FILE_WRITE_DATA, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	}
+
+	/**
+	 * Assert the destination is in the same volume as `target`.
+	 * @param destination The directory where the link will be created
+	 */
+	void assertDestination(const path& destination) const {
+		if (CompareStringOrdinal(getVolume(target).c_str(), -1, getVolume(destination).c_str(), -1, TRUE) != CSTR_EQUAL) [[unlikely]] throw_hresult(HRESULT_FROM_WIN32(ERROR_NOT_SAME_DEVICE));
+	}
+};
+
+/**
+ * Show all [hard links](https://learn.microsoft.com/en-us/windows/win32/fileio/hard-links-and-junctions#hard-links) of a file.
+ *
+ * NTFS records every name of a file in its MFT record, so no index or tree scan is needed.
+ */
+struct HardLinkSiblings : Command {
+	/**
+	 * Initialize all member variables as is.
+	 * @param directory Unused. Nothing will be created
+	 * @param target The file whose hard links will be shown
+	 */
+	HardLinkSiblings(path directory, path target) : Command(directory, target, L"shell32.dll,-23", LOC(L"HardLinkSiblings.GetTitle"), LOC(L"HardLinkSiblings.GetToolTip")) {}
+
+	/**
+	 * Get if the command is enabled.
+	 * @param psiItemArray Unused input. The context is given by the constructor
+	 * @param fOkToBeSlow Unused input. We are not slow
+	 * @param pCmdState Output `ECS_ENABLED` if `target` is a file with more than one hard link, otherwise `ECS_DISABLED`
+	 * @return `S_OK`
+	 */
+	HRESULT GetState([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] BOOL fOkToBeSlow, EXPCMDSTATE* pCmdState) {
+		*pCmdState = ECS_DISABLED;
+		if (is_directory(target)) return S_OK;
+
+		const auto file = CreateFileW(target.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) [[unlikely]] return S_OK;
+
+		BY_HANDLE_FILE_INFORMATION information;
+		if (GetFileInformationByHandle(file, &information) && information.nNumberOfLinks > 1) {
+			*pCmdState = ECS_ENABLED;
+		}
+		CloseHandle(file);
+		return S_OK;
+	}
+
+	/**
+	 * Show all hard links of `target`, one per line.
+	 *
+	 * The names are relative to the mount point of the volume, which is not necessarily a drive root.
 	 * @param psiItemArray Unused input. The context is given by the constructor
 	 * @param pbc Unused input. The context is given by the constructor
-	 * @return `S_OK` on command execution, most likely
+	 * @return `S_OK` on success, the error code otherwise
 	 */
 	HRESULT Invoke([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] IBindCtx* pbc) {
-		const auto link = getLink();
-		return createLink(link, format(L"/C mklink /H \"{}\" \"{}\"", link.wstring(), target.wstring()), CreateFileW(target.c_str(), FILE_WRITE_DATA, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+		wstring siblings;
+		wstring root;
+		wstring name(32767, 0);
+		auto length = DWORD(name.size());
+		void* find = INVALID_HANDLE_VALUE;
+		try {
+			root = getVolume(target);
+			root.pop_back();
+			find = FindFirstFileNameW(target.c_str(), 0, &length, name.data());
+			if (find == INVALID_HANDLE_VALUE) [[unlikely]] throw_last_error();
+		}
+		catch (const hresult_error e) {
+			MessageBoxW(nullptr, e.message().c_str(), LOC(L"Command.Error"), MB_ICONERROR);
+			return e.code();
+		}
+
+		do {
+			siblings += format(L"{}{}\n", root, name.c_str());
+			length = DWORD(name.size());
+		} while (FindNextFileNameW(find, &length, name.data()));
+		FindClose(find);
+
+		MessageBoxW(nullptr, siblings.c_str(), LOC(L"HardLinkSiblings.GetTitle"), MB_ICONINFORMATION);
+		return S_OK;
 	}
 };
 
@@ -355,14 +739,281 @@ struct DirectoryJunction : Command {
 	}
 
 	/**
-	 * Create a directory junction.
+	 * Get the statements creating a directory junction.
+	 * @param link The link to create
+	 * @param destination Unused input. Junctions are always absolute
+	 * @return The `mklink` statement
+	 */
+	const vector<wstring> getStatements(const path& link, [[maybe_unused]] const path& destination) const {
+		return {format(L"mklink /J \"{}\" \"{}\"", link.wstring(), target.wstring())};
+	}
+
+	/**
+	 * Assert both the destination and `target` are in this computer.
+	 * @param destination The directory where the link will be created
+	 */
+	void assertDestination(const path& destination) const {
+		if (GetDriveTypeW(getVolume(target).c_str()) == DRIVE_REMOTE || GetDriveTypeW(getVolume(destination).c_str()) == DRIVE_REMOTE) [[unlikely]] throw_hresult(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+	}
+};
+
+/**
+ * Recreate the symbolic links and junctions inside a directory, for instance after migrating the directory elsewhere.
+ *
+ * Only links are recreated. Files and directories are not copied.
+ *
+ * If the destination already has a directory of the same name, for instance the migrated copy, the links are recreated in it. So links to the inside of `target` point at the migrated files. Links already there are kept.
+ */
+struct LinkStructure : Command {
+	/**
+	 * Initialize all member variables as is.
+	 * @param directory The directory where the structure will be created
+	 * @param target The directory whose links will be recreated
+	 */
+	LinkStructure(path directory, path target) : Command(directory, target, L"shell32.dll,-5", LOC(L"LinkStructure.GetTitle"), LOC(L"LinkStructure.GetToolTip")) {}
+
+	/**
+	 * Get if the command is enabled.
 	 * @param psiItemArray Unused input. The context is given by the constructor
-	 * @param pbc Unused input. The context is given by the constructor
-	 * @return `S_OK` on command execution, most likely
+	 * @param fOkToBeSlow Unused input. We are not slow
+	 * @param pCmdState Output `ECS_ENABLED` if `target` is a directory, otherwise `ECS_DISABLED`
+	 * @return `S_OK`
 	 */
-	HRESULT Invoke([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] IBindCtx* pbc) {
-		const auto link = getLink();
-		return createLink(link, format(L"/C mklink /J \"{}\" \"{}\"", link.wstring(), target.wstring()));
+	HRESULT GetState([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] BOOL fOkToBeSlow, EXPCMDSTATE* pCmdState) {
+		if (is_directory(target)) {
+			*pCmdState = ECS_ENABLED;
+		}
+		else {
+			*pCmdState = ECS_DISABLED;
+		}
+		return S_OK;
+	}
+
+	/**
+	 * Find every link of `target`, once for all destinations.
+	 *
+	 * The walk uses long paths, so it doesn't stop at `MAX_PATH`.
+	 * @param report Output a line for every directory or link which can't be read
+	 */
+	void prepare(wstring& report) {
+		links.clear();
+		normalized = normalize(target);
+		root = getLongPath(target);
+		findLinks(path(), report);
+	}
+
+	/**
+	 * Get the statements recreating every link of `target` under `link`.
+	 *
+	 * Targets are recreated as stored, so relative links stay relative and dangling links are kept. Only absolute targets inside `target` are rewritten to point inside `link`.
+	 *
+	 * Links are created with long paths, so they don't stop at `MAX_PATH`. `md` fails quietly on existing directories.
+	 * @param link The root of the new structure
+	 * @param destination Unused input. Targets are relative to the links, not to the destination
+	 * @return The `md` and `mklink` statements
+	 */
+	const vector<wstring> getStatements(const path& link, [[maybe_unused]] const path& destination) const {
+		vector<wstring> statements = {format(L"md \"{}\" 2>nul", getLongPath(link))};
+		statements.reserve(links.size() + 1);
+		for (const auto& [source, stored, argument, relative] : links) {
+			auto rewritten = stored;
+			if (!relative) {
+				auto inner = getInner(stored, target);
+				if (inner.empty() && !normalized.empty()) {
+					inner = getInner(stored, normalized);
+				}
+				if (inner == L".") {
+					rewritten = link;
+				}
+				else if (!inner.empty()) {
+					rewritten = link / inner;
+				}
+			}
+
+			const auto mirror = link / source;
+			statements.push_back(format(L"md \"{}\" 2>nul & mklink {} \"{}\" \"{}\"", getLongPath(mirror.parent_path()), argument, getLongPath(mirror), rewritten.wstring()));
+		}
+		return statements;
+	}
+
+	/**
+	 * Get the root of the new structure. An existing directory of the same name is reused.
+	 * @param destination The directory where the structure will be created
+	 * @return The root path
+	 */
+	[[nodiscard("Pure function")]]
+	const path getLink(const path& destination) const {
+		auto link = destination / target.filename();
+		error_code error;
+		if (is_directory(link, error)) return link;
+		return Command::getLink(destination);
+	}
+
+	/**
+	 * Open the root to test the permission of creating the structure. An existing directory is opened to add files and subdirectories into.
+	 * @param link The root of the new structure
+	 * @return The return value of [`CreateFile`](https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-createfilew)
+	 */
+	[[nodiscard("Please close the handle")]]
+	void* openLink(const path& link) const {
+		error_code error;
+		if (!is_directory(link, error)) return Command::openLink(link);
+		return CreateFileW(link.c_str(), FILE_ADD_FILE | FILE_ADD_SUBDIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+	}
+
+private:
+	/**
+	 * A link found in `target`.
+	 */
+	struct Link {
+		/**
+		 * The path of the link, relative to `target`.
+		 */
+		path source;
+		/**
+		 * The target stored in the link. Not followed.
+		 */
+		path stored;
+		/**
+		 * The `mklink` argument of the link type.
+		 */
+		wstring_view argument;
+		/**
+		 * Whether `stored` is relative to the directory of the link.
+		 */
+		bool relative;
+	};
+
+	/**
+	 * Every link found by `prepare`.
+	 */
+	vector<Link> links = vector<Link>();
+	/**
+	 * The final path of `target`, for links which reached it through another path.
+	 */
+	path normalized = path();
+	/**
+	 * `target` with the long path prefix.
+	 */
+	wstring root = wstring();
+
+	/**
+	 * Find every symbolic link and junction in a directory recursively. Links are not followed.
+	 *
+	 * Directories with other reparse points, for instance cloud files, are walked as plain directories.
+	 * @param relative The directory to walk, relative to `root`
+	 * @param report Output a line for every directory or link which can't be read
+	 */
+	void findLinks(const path& relative, wstring& report) {
+		const auto directory_path = path(root) / relative;
+		WIN32_FIND_DATAW data;
+		const auto find = FindFirstFileExW((directory_path / L"*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+		try {
+			if (find == INVALID_HANDLE_VALUE) [[unlikely]] throw_last_error();
+		}
+		catch (const hresult_error e) {
+			report += format(L"{}: {}\n", (target / relative).wstring(), e.message().c_str());
+			return;
+		}
+
+		do {
+			const wstring_view name = data.cFileName;
+			if (name == L"." || name == L"..") continue;
+
+			const auto directory_attribute = data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+			const auto link_attribute = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) && (data.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT || data.dwReserved0 == IO_REPARSE_TAG_SYMLINK);
+			if (!link_attribute) [[likely]] {
+				if (directory_attribute) findLinks(relative / name, report);
+				continue;
+			}
+			wstring_view argument = L"/J";
+			if (data.dwReserved0 == IO_REPARSE_TAG_SYMLINK) {
+				argument = directory_attribute ? L"/D" : L"";
+			}
+
+			try {
+				auto link = readLink(directory_path / name);
+				link.source = relative / name;
+				link.argument = argument;
+				links.push_back(link);
+			}
+			catch (const hresult_error e) {
+				report += format(L"{}: {}\n", (target / relative / name).wstring(), e.message().c_str());
+			}
+		} while (FindNextFileW(find, &data));
+		FindClose(find);
+	}
+
+	/**
+	 * Read the target stored in a symbolic link or junction, without following it. So dangling links can be read too.
+	 *
+	 * The data is laid out as `REPARSE_DATA_BUFFER`, which is only declared in the driver kit. Flag `1` of symbolic links is `SYMLINK_FLAG_RELATIVE`.
+	 *
+	 * Volume mount points have no print name, so their volume name is kept as `\\?\Volume{GUID}\`.
+	 * @param file The link to read
+	 * @return The link with `stored` and `relative` filled
+	 */
+	[[nodiscard("Pure function")]]
+	static Link readLink(const path& file) {
+		const auto handle = CreateFileW(file.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT, nullptr);
+		if (handle == INVALID_HANDLE_VALUE) [[unlikely]] throw_last_error();
+		vector<uint8_t> buffer(MAXIMUM_REPARSE_DATA_BUFFER_SIZE);
+		DWORD size = 0;
+		const auto success = DeviceIoControl(handle, FSCTL_GET_REPARSE_POINT, nullptr, 0, buffer.data(), DWORD(buffer.size()), &size, nullptr);
+		CloseHandle(handle);
+		check_bool(success);
+
+		uint32_t tag = 0;
+		uint16_t names[4] = {};
+		uint32_t flags = 0;
+		memcpy(&tag, buffer.data(), sizeof(tag));
+		memcpy(names, buffer.data() + 8, sizeof(names));
+		size_t offset = 16;
+		if (tag == IO_REPARSE_TAG_SYMLINK) {
+			memcpy(&flags, buffer.data() + offset, sizeof(flags));
+			offset += sizeof(flags);
+		}
+		const auto getName = [&buffer, size, offset](uint16_t name_offset, uint16_t name_length) {
+			if (offset + name_offset + name_length > size) [[unlikely]] throw_hresult(HRESULT_FROM_WIN32(ERROR_INVALID_REPARSE_DATA));
+			wstring name(name_length / sizeof(wchar_t), 0);
+			memcpy(name.data(), buffer.data() + offset + name_offset, name_length);
+			return name;
+		};
+
+		auto stored = getName(names[2], names[3]);
+		if (stored.empty()) {
+			stored = getName(names[0], names[1]);
+			if (stored.starts_with(L"\\??\\Volume{")) {
+				stored[1] = L'\\';
+			}
+			else if (stored.starts_with(L"\\??\\UNC\\")) {
+				stored.replace(0, 8, L"\\\\");
+			}
+			else if (stored.starts_with(L"\\??\\")) {
+				stored.erase(0, 4);
+			}
+		}
+		return {.source = path(), .stored = stored, .argument = wstring_view(), .relative = bool(flags & 1)};
+	}
+
+	/**
+	 * Get the path of a file relative to a root, ignoring case as the file system does.
+	 * @param file The absolute path of the file
+	 * @param root The absolute path of the root
+	 * @return The relative path, `.` if `file` is `root`, or empty if `file` is not inside `root`
+	 */
+	[[nodiscard("Pure function")]]
+	static const path getInner(const path& file, const path& root) {
+		auto file_string = file.lexically_normal().wstring();
+		auto root_string = root.lexically_normal().wstring();
+		if (!file_string.ends_with(L'\\')) file_string += L'\\';
+		if (!root_string.ends_with(L'\\')) root_string += L'\\';
+		const auto size = int(root_string.size());
+		if (file_string.size() < root_string.size() || CompareStringOrdinal(file_string.data(), size, root_string.data(), size, TRUE) != CSTR_EQUAL) return path();
+
+		if (file_string.size() == root_string.size()) return L".";
+		file_string.pop_back();
+		return file_string.substr(root_string.size());
 	}
 };
 
@@ -380,18 +1031,17 @@ struct InternetShortcut : Command {
 	InternetShortcut(path directory, path target) : Command(directory, target, L"shell32.dll,-14", LOC(L"InternetShortcut.GetTitle"), LOC(L"InternetShortcut.GetToolTip"), L"powershell", L".url") {}
 
 	/**
-	 * Create an internet shortcut.
-	 * @param psiItemArray Unused input. The context is given by the constructor
-	 * @param pbc Unused input. The context is given by the constructor
-	 * @return `S_OK` on command execution, most likely
+	 * Get the statements creating an internet shortcut.
+	 * @param link The link to create
+	 * @param destination Unused input. The URL is absolute
+	 * @return The PowerShell statement
 	 */
-	HRESULT Invoke([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] IBindCtx* pbc) {
-		const auto link = getLink();
+	const vector<wstring> getStatements(const path& link, [[maybe_unused]] const path& destination) const {
 		// clang-format off
-		return createLink(link, format(L"-Command New-Item '{}' -Value '\
-			[InternetShortcut]                                        \n\
-			URL = {}                                                  \n\
-		'", link.wstring(), target.wstring()));
+		return {format(L"New-Item '{}' -Value '\
+			[InternetShortcut]                \n\
+			URL = {}                          \n\
+		'", link.wstring(), target.wstring())};
 		// clang-format on
 	}
 };
@@ -410,23 +1060,46 @@ struct ShellLink : Command {
 	ShellLink(path directory, path target) : Command(directory, target, L"shell32.dll,-25", LOC(L"ShellLink.GetTitle"), LOC(L"ShellLink.GetToolTip"), L"powershell", L".lnk") {}
 
 	/**
-	 * Create a shell link.
-	 * @param psiItemArray Unused input. The context is given by the constructor
-	 * @param pbc Unused input. The context is given by the constructor
-	 * @return `S_OK` on command execution, most likely
+	 * Get the statements creating a shell link.
+	 * @param link The link to create
+	 * @param destination Unused input. The target is absolute
+	 * @return The PowerShell statement
 	 */
-	HRESULT Invoke([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] IBindCtx* pbc) {
-		const auto link = getLink();
+	const vector<wstring> getStatements(const path& link, [[maybe_unused]] const path& destination) const {
 		// clang-format off
-		return createLink(link, format(L"-Command                                  \
+		return {format(L"                                                          \
 			$shortcut = (New-Object -ComObject WScript.Shell).CreateShortcut('{}');\
 			$shortcut.TargetPath = '{}';                                           \
-			$shortcut.Save();                                                      \
-		", link.wstring(), target.wstring()));
+			$shortcut.Save()                                                       \
+		", link.wstring(), target.wstring())};
 		// clang-format on
 	}
 };
 
+/**
+ * The context on which the menu is shown.
+ *
+ * Never modified once published. Writers publish a new one instead, so readers on any thread never see a torn state, and never copy or lock the paths.
+ *
+ * `atomic<shared_ptr>` is not lock-free in libstdc++. It guards the pointer swap with a short internal spin lock, which is still held only for a pointer copy.
+ */
+struct Context {
+	/**
+	 * The directory where the link will be created.
+	 */
+	path directory = path();
+	/**
+	 * The target file or directory to link to.
+	 */
+	path target = path();
+	/**
+	 * The final target of `target`. Empty if `target` is not a link.
+	 *
+	 * Resolved again on every `GetState`, so a link retargeted since is noticed. Shared by every command and destination.
+	 */
+	path resolved = path();
+};
+
 /**
  * Enumerate all sub-commands.
  *
@@ -435,11 +1108,10 @@ struct ShellLink : Command {
 struct Enum : implements<Enum, IEnumExplorerCommand> {
 	/**
 	 * Initialize all member variables as is.
-	 * @param directory The directory where the link will be created
-	 * @param target The target file or directory to link to
+	 * @param context The context on which the menu is shown
 	 * @param command Current command index
 	 */
-	Enum(path directory, path target, uint32_t command = 0) : directory(directory), target(target), command(command) {}
+	Enum(shared_ptr<const Context> context, uint32_t command = 0) : context(context), command(command) {}
 
 	/**
 	 * Get the clone of the enum.
@@ -447,7 +1119,7 @@ struct Enum : implements<Enum, IEnumExplorerCommand> {
 	 * @return `S_OK` on success, most likely
 	 */
 	HRESULT Clone(IEnumExplorerCommand** ppenum) {
-		return make<Enum>(directory, target, command)->QueryInterface(ppenum);
+		return make<Enum>(context, command)->QueryInterface(ppenum);
 	}
 
 	/**
@@ -458,6 +1130,9 @@ struct Enum : implements<Enum, IEnumExplorerCommand> {
 	 * @return `S_OK` if the number of commands fetched is equal to `celt`, `S_FALSE` otherwise
 	 */
 	HRESULT Next(ULONG celt, IExplorerCommand** pUICommand, ULONG* pceltFetched) {
+		const auto& directory = context->directory;
+		const auto& target = context->target;
+		const auto& resolved = context->resolved;
 		auto result = S_OK;
 		uint8_t fetched = 0;
 
@@ -470,15 +1145,27 @@ struct Enum : implements<Enum, IEnumExplorerCommand> {
 					result = make<RelativeSymbolicLink>(directory, target)->QueryInterface(fetched + pUICommand);
 					break;
 				case 2:
-					result = make<HardLink>(directory, target)->QueryInterface(fetched + pUICommand);
+					result = make<AbsoluteSymbolicLink>(directory, resolved, true)->QueryInterface(fetched + pUICommand);
 					break;
 				case 3:
-					result = make<DirectoryJunction>(directory, target)->QueryInterface(fetched + pUICommand);
+					result = make<RelativeSymbolicLink>(directory, resolved, true)->QueryInterface(fetched + pUICommand);
 					break;
 				case 4:
-					result = make<InternetShortcut>(directory, target)->QueryInterface(fetched + pUICommand);
+					result = make<HardLink>(directory, target)->QueryInterface(fetched + pUICommand);
 					break;
 				case 5:
+					result = make<HardLinkSiblings>(directory, target)->QueryInterface(fetched + pUICommand);
+					break;
+				case 6:
+					result = make<DirectoryJunction>(directory, target)->QueryInterface(fetched + pUICommand);
+					break;
+				case 7:
+					result = make<LinkStructure>(directory, target)->QueryInterface(fetched + pUICommand);
+					break;
+				case 8:
+					result = make<InternetShortcut>(directory, target)->QueryInterface(fetched + pUICommand);
+					break;
+				case 9:
 					result = make<ShellLink>(directory, target)->QueryInterface(fetched + pUICommand);
 					break;
 				default:
@@ -516,13 +1203,9 @@ struct Enum : implements<Enum, IEnumExplorerCommand> {
 
 private:
 	/**
-	 * The directory where the link will be created.
+	 * The context on which the menu is shown. Shared with the clones.
 	 */
-	const path directory;
-	/**
-	 * The target file or directory to link to.
-	 */
-	const path target;
+	const shared_ptr<const Context> context;
 	/**
 	 * Current command index.
 	 */
@@ -541,7 +1224,7 @@ struct Mklink : implements<Mklink, IExplorerCommand, IObjectWithSite> {
 	 * @return `S_OK` on success, most likely
 	 */
 	HRESULT EnumSubCommands(IEnumExplorerCommand** ppEnum) {
-		return make<Enum>(directory, target)->QueryInterface(ppEnum);
+		return make<Enum>(context.load())->QueryInterface(ppEnum);
 	}
 
 	/**
@@ -576,39 +1259,64 @@ struct Mklink : implements<Mklink, IExplorerCommand, IObjectWithSite> {
 	/**
 	 * Get the previously set site.
 	 * @param riid Requested interface ID
-	 * @param ppvSite Output pointer to the interface
-	 * @return `S_OK` on success, most likely
+	 * @param ppvSite Output pointer to the interface, or null if there's no site
+	 * @return `S_OK` on success, `E_FAIL` if there's no site
 	 */
 	HRESULT GetSite(REFIID riid, void** ppvSite) {
-		return provider->QueryInterface(riid, ppvSite);
+		const auto site = provider.load();
+		if (*site == nullptr) [[unlikely]] {
+			*ppvSite = nullptr;
+			return E_FAIL;
+		}
+		return (*site)->QueryInterface(riid, ppvSite);
 	}
 
 	/**
 	 * Get if the command is enabled.
 	 *
 	 * @param psiItemArray Unused input. `explorer.exe` always calls `GetState` with null-`psiItemArray`
-	 * @param fOkToBeSlow Unused input. We are not slow
+	 * @param fOkToBeSlow Input `FALSE` if the state must be computed quickly. Reading the clipboard is, so the copied target is published right away. Resolving the copied link is not, for instance on an offline share, so it waits for the slow call
 	 * @param pCmdState Output `ECS_ENABLED` if user copied single file or directory, `ECS_DISABLED` otherwise
-	 * @return `S_OK`
+	 * @return `S_OK`, or `E_PENDING` to be called again with `fOkToBeSlow`
 	 */
-	HRESULT GetState([[maybe_unused]] IShellItemArray* psiItemArray, [[maybe_unused]] BOOL fOkToBeSlow, EXPCMDSTATE* pCmdState) {
-		if (directory.empty() || !OpenClipboard(nullptr)) [[unlikely]] {
+	HRESULT GetState([[maybe_unused]] IShellItemArray* psiItemArray, BOOL fOkToBeSlow, EXPCMDSTATE* pCmdState) {
+		if (context.load()->directory.empty() || !OpenClipboard(nullptr)) [[unlikely]] {
 			*pCmdState = ECS_DISABLED;
 			return S_OK;
 		}
 
 		auto data = HDROP(GetClipboardData(CF_HDROP));
+		path target;
 		if (DragQueryFileW(data, 0xFFFFFFFF, nullptr, 0) == 1) [[unlikely]] {
-			*pCmdState = ECS_ENABLED;
 			wstring target_string(32767, 0);
 			DragQueryFileW(data, 0, target_string.data(), 32767);
 			target = target_string.c_str();
 		}
-		else {
+		CloseClipboard();
+
+		if (target.empty()) [[likely]] {
 			*pCmdState = ECS_DISABLED;
+			return S_OK;
+		}
+		*pCmdState = ECS_ENABLED;
+		const auto current = context.load();
+		if (!fOkToBeSlow) {
+			if (target != current->target) {
+				publish([&target](Context& next) {
+					next.target = target;
+					next.resolved.clear();
+				});
+			}
+			return E_PENDING;
 		}
 
-		CloseClipboard();
+		const auto resolved = resolve(target);
+		if (target != current->target || resolved != current->resolved) {
+			publish([&target, &resolved](Context& next) {
+				next.target = target;
+				next.resolved = resolved;
+			});
+		}
 		return S_OK;
 	}
 
@@ -649,16 +1357,20 @@ struct Mklink : implements<Mklink, IExplorerCommand, IObjectWithSite> {
 	 */
 	HRESULT SetSite(IUnknown* pUnkSite) {
 		if (pUnkSite == nullptr) [[unlikely]] {
-			directory.clear();
-			provider = nullptr;
+			publish([](Context& next) {
+				next.directory.clear();
+			});
+			provider = make_shared<const com_ptr<IServiceProvider>>();
 			return S_OK;
 		}
 
 		ITEMIDLIST* list = nullptr;
+		com_ptr<IServiceProvider> site;
+		path directory;
 		try {
-			check_hresult(pUnkSite->QueryInterface(provider.put()));
+			check_hresult(pUnkSite->QueryInterface(site.put()));
 			com_ptr<IShellBrowser> browser;
-			check_hresult(provider->QueryService(IID_IShellBrowser, browser.put()));
+			check_hresult(site->QueryService(IID_IShellBrowser, browser.put()));
 			com_ptr<IShellView> shell;
 			check_hresult(browser->QueryActiveShellView(shell.put()));
 			com_ptr<IPersistFolder2> folder;
@@ -673,22 +1385,39 @@ struct Mklink : implements<Mklink, IExplorerCommand, IObjectWithSite> {
 		}
 
 		CoTaskMemFree(list);
+		provider = make_shared<const com_ptr<IServiceProvider>>(site);
+		publish([&directory](Context& next) {
+			next.directory = directory;
+		});
 		return S_OK;
 	}
 
 private:
 	/**
 	 * Pointer to the service provider (site).
+	 *
+	 * Kept out of `Context`, as it belongs to the apartment of `SetSite`. Copying snapshots on other threads must not reference it.
 	 */
-	com_ptr<IServiceProvider> provider = nullptr;
+	atomic<shared_ptr<const com_ptr<IServiceProvider>>> provider {make_shared<const com_ptr<IServiceProvider>>()};
 	/**
-	 * The directory where the link will be created.
+	 * The currently published context. Swapped as a whole by `publish`.
 	 */
-	path directory = path();
+	atomic<shared_ptr<const Context>> context {make_shared<const Context>()};
+
 	/**
-	 * The target file or directory to link to.
+	 * Publish a new context based on the current one.
+	 *
+	 * `GetState` and `SetSite` may be called from different threads. Retry if another one published in between, so neither update is lost.
+	 * @param update Function modifying a copy of the current context
 	 */
-	path target = path();
+	void publish(const auto update) {
+		auto current = context.load();
+		shared_ptr<Context> next;
+		do {
+			next = make_shared<Context>(*current);
+			update(*next);
+		} while (!context.compare_exchange_weak(current, next));
+	}
 };
 
 /**
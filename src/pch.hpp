@@ -3,9 +3,14 @@
 
 #ifndef PCH_HPP
 	#define PCH_HPP
+	#include <atomic>
+	#include <cstring>
 	#include <filesystem>
 	#include <initguid.h>
+	#include <memory>
 	#include <shlobj.h>
 	#include <shlwapi.h>
+	#include <vector>
+	#include <winioctl.h>
 	#include <winrt/windows.applicationmodel.resources.h>
 #endif